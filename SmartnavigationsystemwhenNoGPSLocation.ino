@@ -129,6 +129,9 @@ void uploadTelemetry() {
   
   json.set("location/lat", lat);
   json.set("location/lng", lon);
+  // Kept outside "location", which the dashboard passes to Maps as a LatLng.
+  // isValid() stays true after the first fix, so also require a fresh one.
+  json.set("gpsFix", gps.location.isValid() && gps.location.age() < 2000);
   json.set("battery", 88); 
   json.set("status", "online");
   json.set("isLocked", isLocked);
@@ -0,0 +1,221 @@
+// Map-matching benchmark on simulated noisy bike trips with known ground truth.
+//
+// Build & run (host machine, not the ESP32):
+//   g++ -O2 -std=c++17 -pthread map_match_bench.cpp -o map_match_bench
+//   ./map_match_bench [trips] [threads]
+//
+// Reports traces/second single-threaded vs. on the work-stealing pool, the
+// share of valid fixes snapped to the true road segment, and trip distance error of
+// the matched track compared to summing the raw GPS fixes.
+
+#include "map_matcher.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+using namespace mapmatch;
+
+// ================== CONFIGURATION ==================
+static const GeoPoint ORIGIN = { 27.176, 75.956 };  // same default as the firmware
+#define GRID_SIZE 60           // intersections per side
+#define BLOCK_METERS 100.0     // spacing between intersections
+#define NODE_JITTER 15.0       // makes roads non axis-aligned
+#define DROP_ROAD_PCT 10       // missing blocks, so routes aren't trivially straight
+#define SAMPLE_SECONDS 2.0     // matches the telemetry upload interval
+#define GPS_SIGMA 8.0
+#define OUTLIER_PCT 2          // multipath jumps
+#define OUTLIER_METERS 40.0
+#define NO_FIX_PCT 1           // fallback coordinates sent without a fix
+#define TIMING_RUNS 3          // timed repetitions per thread count
+
+// ================== SIMULATION ==================
+
+struct TruthFix { int segment; double x, y; };
+
+struct SimTrip {
+  Trace trace;
+  std::vector<TruthFix> truth;  // one per fix
+  double distance;              // ground-truth distance between first/last fix
+};
+
+static RoadGraph buildCity(std::mt19937& rng) {
+  RoadGraph graph(ORIGIN);
+  std::uniform_real_distribution<double> jitter(-NODE_JITTER, NODE_JITTER);
+  std::uniform_int_distribution<int> pct(0, 99);
+  const Projection& proj = graph.projection();
+  for (int r = 0; r < GRID_SIZE; r++)
+    for (int c = 0; c < GRID_SIZE; c++)
+      graph.addNode(proj.toGeo(c * BLOCK_METERS + jitter(rng), r * BLOCK_METERS + jitter(rng)));
+  for (int r = 0; r < GRID_SIZE; r++)
+    for (int c = 0; c < GRID_SIZE; c++) {
+      int n = r * GRID_SIZE + c;
+      if (c + 1 < GRID_SIZE && pct(rng) >= DROP_ROAD_PCT) graph.addSegment(n, n + 1);
+      if (r + 1 < GRID_SIZE && pct(rng) >= DROP_ROAD_PCT) graph.addSegment(n, n + GRID_SIZE);
+    }
+  return graph;
+}
+
+static SimTrip simulateTrip(const RoadGraph& graph, int id, std::mt19937& rng) {
+  const auto& nodes = graph.nodes();
+  const auto& segs = graph.segments();
+  std::uniform_int_distribution<int> pickNode(0, (int)nodes.size() - 1);
+  std::uniform_int_distribution<int> pct(0, 99);
+  std::uniform_int_distribution<int> legs(10, 120);  // very uneven trip lengths
+  std::uniform_real_distribution<double> speed(3.0, 7.0);
+  std::uniform_real_distribution<double> angle(0, 2 * 3.14159265358979323846);
+  std::normal_distribution<double> noise(0, GPS_SIGMA);
+
+  // Random walk without immediate U-turns.
+  std::vector<std::pair<int, int>> path;  // (segment, start node)
+  int node = pickNode(rng), prevSeg = -1;
+  for (int n = legs(rng); n > 0; n--) {
+    const auto& arcs = graph.arcs(node);
+    if (arcs.empty()) break;
+    std::vector<RoadGraph::Arc> options;
+    for (const auto& a : arcs) if (a.segment != prevSeg) options.push_back(a);
+    if (options.empty()) options = arcs;
+    const auto& arc = options[std::uniform_int_distribution<int>(0, (int)options.size() - 1)(rng)];
+    path.push_back({ arc.segment, node });
+    prevSeg = arc.segment;
+    node = arc.to;
+  }
+
+  SimTrip trip;
+  trip.trace.tripId = "trip_" + std::to_string(id);
+  double v = speed(rng), travelled = 0, walked = 0;
+  size_t leg = 0;
+  for (;; travelled += v * SAMPLE_SECONDS) {
+    while (leg < path.size() && travelled > walked + segs[path[leg].first].length) {
+      walked += segs[path[leg].first].length;
+      leg++;
+    }
+    if (leg >= path.size()) break;
+    const auto& s = segs[path[leg].first];
+    int from = path[leg].second, to = s.a == from ? s.b : s.a;
+    double t = (travelled - walked) / s.length;
+    double x = nodes[from].x + t * (nodes[to].x - nodes[from].x);
+    double y = nodes[from].y + t * (nodes[to].y - nodes[from].y);
+    trip.truth.push_back({ path[leg].first, x, y });
+
+    double nx = x + noise(rng), ny = y + noise(rng);
+    if (pct(rng) < OUTLIER_PCT) {
+      double a = angle(rng);
+      nx += OUTLIER_METERS * std::cos(a);
+      ny += OUTLIER_METERS * std::sin(a);
+    }
+    GeoPoint g = graph.projection().toGeo(nx, ny);
+    if (pct(rng) < NO_FIX_PCT) trip.trace.fixes.push_back({ ORIGIN.lat, ORIGIN.lon, false });
+    else trip.trace.fixes.push_back({ g.lat, g.lon, true });
+  }
+  trip.distance = trip.truth.empty() ? 0 : travelled - v * SAMPLE_SECONDS;
+  return trip;
+}
+
+// ================== MAIN ==================
+
+static double rawDistance(const Projection& proj, const Trace& trace) {
+  double total = 0, px = 0, py = 0;
+  bool have = false;
+  for (const auto& f : trace.fixes) {
+    if (!f.valid) continue;
+    double x, y;
+    proj.toXY({ f.lat, f.lon }, x, y);
+    if (have) total += std::hypot(x - px, y - py);
+    px = x; py = y; have = true;
+  }
+  return total;
+}
+
+int main(int argc, char** argv) {
+  long tripsArg = argc > 1 ? std::atol(argv[1]) : 2000;
+  long threadsArg = argc > 2 ? std::atol(argv[2]) : 0;
+  if (tripsArg < 0 || threadsArg < 0 || threadsArg > 1024) {
+    fprintf(stderr, "Usage: %s [trips >= 0] [threads 0..1024, 0 = all cores]\n", argv[0]);
+    return 2;
+  }
+  size_t trips = (size_t)tripsArg;
+  unsigned threads = (unsigned)threadsArg;
+  if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+  std::mt19937 rng(42);
+  RoadGraph graph = buildCity(rng);
+  std::vector<SimTrip> sims;
+  std::vector<Trace> traces;
+  size_t totalFixes = 0;
+  for (size_t i = 0; i < trips; i++) {
+    sims.push_back(simulateTrip(graph, (int)i, rng));
+    traces.push_back(sims.back().trace);
+    totalFixes += traces.back().fixes.size();
+  }
+  printf("Graph: %zu nodes, %zu segments | %zu trips, %zu fixes\n",
+         graph.nodes().size(), graph.segments().size(), trips, totalFixes);
+
+  MatchConfig config;
+  config.gpsSigma = GPS_SIGMA;
+  MapMatcher matcher(graph, config);
+
+  // One untimed warm-up pass, then the best of TIMING_RUNS per configuration,
+  // alternating the two so neither always runs on a cold or a hot machine.
+  std::vector<MatchResult> serial, parallel;
+  matcher.matchAll(traces, threads);
+  double tSerial = 1e300, tParallel = 1e300;
+  for (int run = 0; run < TIMING_RUNS; run++) {
+    auto timed = [&](unsigned n, std::vector<MatchResult>& out) {
+      auto t0 = std::chrono::steady_clock::now();
+      out = matcher.matchAll(traces, n);
+      return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    };
+    tSerial = std::min(tSerial, timed(1, serial));
+    if (threads > 1) tParallel = std::min(tParallel, timed(threads, parallel));
+  }
+  printf("1 thread : %8.1f traces/s  %10.0f fixes/s  (best of %d)\n",
+         trips / tSerial, totalFixes / tSerial, TIMING_RUNS);
+  if (threads > 1)
+    printf("%u threads: %8.1f traces/s  %10.0f fixes/s  (x%.2f)\n",
+           threads, trips / tParallel, totalFixes / tParallel, tSerial / tParallel);
+  else
+    parallel = serial;
+
+  size_t mismatched = 0;
+  for (size_t i = 0; i < trips; i++)
+    if (serial[i].distanceMeters != parallel[i].distanceMeters ||
+        serial[i].matched.size() != parallel[i].matched.size()) mismatched++;
+  if (mismatched) printf("WARNING: %zu trips differ between serial and parallel runs\n", mismatched);
+
+  // ---- Accuracy against ground truth ----
+  const Projection& proj = graph.projection();
+  size_t matched = 0, correct = 0, validFixes = 0, skipped = 0, breaks = 0;
+  double snapErr = 0, rawErr = 0, matchErr = 0, truthTotal = 0;
+  for (size_t i = 0; i < trips; i++) {
+    const SimTrip& sim = sims[i];
+    const MatchResult& res = parallel[i];
+    for (const auto& f : sim.trace.fixes) validFixes += f.valid;
+    for (const auto& m : res.matched) {
+      const TruthFix& t = sim.truth[m.fixIndex];
+      double x, y;
+      proj.toXY(m.snapped, x, y);
+      double err = std::hypot(x - t.x, y - t.y);
+      // At an intersection either adjoining segment is the same place.
+      if (m.segment == t.segment || err < 1.0) correct++;
+      snapErr += err;
+      matched++;
+    }
+    skipped += res.skippedFixes;
+    breaks += res.geometry.empty() ? 0 : res.geometry.size() - 1;
+    truthTotal += sim.distance;
+    rawErr += std::fabs(rawDistance(proj, sim.trace) - sim.distance);
+    matchErr += std::fabs(res.distanceMeters - sim.distance);
+  }
+  printf("Matched %zu / %zu valid fixes (%zu skipped as too close), %zu chain breaks\n",
+         matched, validFixes, skipped, breaks);
+  // Valid fixes without a MatchedFix (skipped, or no road in range) are misses.
+  printf("Correct segment: %.2f%% of valid fixes (%.2f%% of matched)\n",
+         100.0 * correct / std::max<size_t>(validFixes, 1), 100.0 * correct / std::max<size_t>(matched, 1));
+  printf("Mean snap error of matched fixes: %.2f m (GPS sigma %.1f m)\n",
+         snapErr / std::max<size_t>(matched, 1), GPS_SIGMA);
+  printf("Trip distance error: raw fixes %.2f%%   matched %.2f%%\n",
+         100.0 * rawErr / std::max(truthTotal, 1.0), 100.0 * matchErr / std::max(truthTotal, 1.0));
+  return mismatched ? 1 : 0;
+}
@@ -0,0 +1,147 @@
+// Batch map-matching of stored GPS traces: one JSON line per trip on stdout.
+//
+// Build & run (host machine, not the ESP32):
+//   g++ -O2 -std=c++17 -pthread map_match_cli.cpp -o map_match_cli
+//   ./map_match_cli roads.txt traces.csv [threads] > matched.jsonl
+//
+// roads.txt, whitespace separated, '#' starts a comment:
+//   N <lat> <lon>     node; nodes are numbered 0, 1, 2... in file order
+//   E <node> <node>   two-way road segment between two nodes
+//
+// traces.csv, one fix per line in time order, exactly four columns (a first
+// line whose lat/lon aren't numbers is taken as a header and skipped):
+//   <tripId>,<lat>,<lon>,<gpsFix 0|1>
+//
+// Output per trip:
+//   {"tripId":"...","distanceMeters":1234.5,"matchedFixes":N,"droppedFixes":N,
+//    "geometry":[[[lat,lon],...],...]}
+
+#include "map_matcher.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+using namespace mapmatch;
+
+static bool loadRoads(const char* path, std::vector<GeoPoint>& nodes,
+                      std::vector<std::pair<int, int>>& edges) {
+  std::ifstream in(path);
+  if (!in) { fprintf(stderr, "Cannot open roads file %s\n", path); return false; }
+  std::string line;
+  for (int lineNo = 1; std::getline(in, line); lineNo++) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream ss(line);
+    std::string kind;
+    if (!(ss >> kind)) continue;
+    if (kind == "N") {
+      GeoPoint p;
+      if (ss >> p.lat >> p.lon) { nodes.push_back(p); continue; }
+    } else if (kind == "E") {
+      int a, b;
+      if (ss >> a >> b && a >= 0 && b >= 0) { edges.push_back({ a, b }); continue; }
+    }
+    fprintf(stderr, "%s:%d: bad line\n", path, lineNo);
+    return false;
+  }
+  for (const auto& e : edges)
+    if (e.first >= (int)nodes.size() || e.second >= (int)nodes.size()) {
+      fprintf(stderr, "%s: edge %d-%d references a missing node\n", path, e.first, e.second);
+      return false;
+    }
+  if (nodes.empty()) { fprintf(stderr, "%s: no nodes\n", path); return false; }
+  return true;
+}
+
+static bool loadTraces(const char* path, std::vector<Trace>& traces) {
+  std::ifstream in(path);
+  if (!in) { fprintf(stderr, "Cannot open traces file %s\n", path); return false; }
+  std::unordered_map<std::string, size_t> byTrip;
+  std::string line;
+  for (int lineNo = 1; std::getline(in, line); lineNo++) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (line.empty()) continue;
+    std::istringstream ss(line);
+    std::string id, lat, lon, fix;
+    std::getline(ss, id, ',');
+    std::getline(ss, lat, ',');
+    std::getline(ss, lon, ',');
+    std::getline(ss, fix, ',');
+    char* end = nullptr;
+    GpsFix f;
+    f.lat = std::strtod(lat.c_str(), &end);
+    bool numeric = !lat.empty() && *end == '\0';
+    f.lon = std::strtod(lon.c_str(), &end);
+    numeric = numeric && !lon.empty() && *end == '\0';
+    // Only a first line whose coordinates aren't numbers is a header.
+    if (!numeric && lineNo == 1) continue;
+    bool extra = std::count(line.begin(), line.end(), ',') != 3;
+    if (!numeric || extra || (fix != "0" && fix != "1")) {
+      fprintf(stderr, "%s:%d: bad line\n", path, lineNo);
+      return false;
+    }
+    f.valid = fix == "1";
+    auto it = byTrip.find(id);
+    if (it == byTrip.end()) {
+      it = byTrip.emplace(id, traces.size()).first;
+      traces.push_back({ id, {} });
+    }
+    traces[it->second].fixes.push_back(f);
+  }
+  return true;
+}
+
+static void writeJsonString(const std::string& s) {
+  putchar('"');
+  for (char c : s) {
+    if (c == '"' || c == '\\') printf("\\%c", c);
+    else if ((unsigned char)c < 0x20) printf("\\u%04x", c);
+    else putchar(c);
+  }
+  putchar('"');
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    fprintf(stderr, "Usage: %s roads.txt traces.csv [threads]\n", argv[0]);
+    return 2;
+  }
+  unsigned threads = 0;  // all cores
+  if (argc > 3) {
+    char* end = nullptr;
+    long n = std::strtol(argv[3], &end, 10);
+    if (*argv[3] == '\0' || *end != '\0' || n <= 0 || n > 1024) {
+      fprintf(stderr, "threads must be a number between 1 and 1024, got '%s'\n", argv[3]);
+      return 2;
+    }
+    threads = (unsigned)n;
+  }
+
+  std::vector<GeoPoint> nodes;
+  std::vector<std::pair<int, int>> edges;
+  std::vector<Trace> traces;
+  if (!loadRoads(argv[1], nodes, edges) || !loadTraces(argv[2], traces)) return 1;
+
+  RoadGraph graph(nodes[0]);
+  for (const auto& p : nodes) graph.addNode(p);
+  for (const auto& e : edges) graph.addSegment(e.first, e.second);
+
+  MapMatcher matcher(graph);
+  std::vector<MatchResult> results = matcher.matchAll(traces, threads);
+
+  for (const auto& r : results) {
+    printf("{\"tripId\":");
+    writeJsonString(r.tripId);
+    printf(",\"distanceMeters\":%.1f,\"matchedFixes\":%zu,\"droppedFixes\":%zu,\"geometry\":[",
+           r.distanceMeters, r.matched.size(), r.droppedFixes);
+    for (size_t i = 0; i < r.geometry.size(); i++) {
+      printf(i ? ",[" : "[");
+      for (size_t j = 0; j < r.geometry[i].size(); j++)
+        printf("%s[%.7f,%.7f]", j ? "," : "", r.geometry[i][j].lat, r.geometry[i][j].lon);
+      printf("]");
+    }
+    printf("]}\n");
+  }
+  return 0;
+}
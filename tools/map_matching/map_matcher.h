@@ -0,0 +1,493 @@
+#pragma once
+
+// Offline HMM/Viterbi map-matching of recorded bike traces onto a road graph.
+// Host-side only (not part of the ESP32 sketch): snaps jittery TinyGPS fixes
+// to road segments and reports cleaned geometry and on-road trip distance.
+// Trips are matched in parallel on a small work-stealing pool.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace mapmatch {
+
+// ================== GEOMETRY ==================
+
+struct GeoPoint { double lat; double lon; };
+
+// Equirectangular projection around a reference point. Plenty accurate for a
+// city-sized area and much cheaper than haversine in the inner loops.
+class Projection {
+public:
+  explicit Projection(GeoPoint origin)
+    : origin_(origin), cosLat_(std::cos(origin.lat * kDegToRad)) {}
+
+  void toXY(GeoPoint p, double& x, double& y) const {
+    x = (p.lon - origin_.lon) * kDegToRad * kEarthRadius * cosLat_;
+    y = (p.lat - origin_.lat) * kDegToRad * kEarthRadius;
+  }
+
+  GeoPoint toGeo(double x, double y) const {
+    return { origin_.lat + y / (kDegToRad * kEarthRadius),
+             origin_.lon + x / (kDegToRad * kEarthRadius * cosLat_) };
+  }
+
+private:
+  static constexpr double kDegToRad = 3.14159265358979323846 / 180.0;
+  static constexpr double kEarthRadius = 6371000.0;
+  GeoPoint origin_;
+  double cosLat_;
+};
+
+// ================== ROAD GRAPH ==================
+
+// Undirected road network: nodes are intersections/shape points, segments are
+// straight pieces between two nodes. Coordinates are kept projected (metres).
+class RoadGraph {
+public:
+  struct Node { double x; double y; };
+  struct Segment { int a; int b; double length; };
+  struct Arc { int to; int segment; };
+
+  explicit RoadGraph(GeoPoint origin) : proj_(origin) {}
+
+  int addNode(GeoPoint p) {
+    Node n;
+    proj_.toXY(p, n.x, n.y);
+    nodes_.push_back(n);
+    adj_.emplace_back();
+    return (int)nodes_.size() - 1;
+  }
+
+  int addSegment(int a, int b) {
+    double len = std::hypot(nodes_[b].x - nodes_[a].x, nodes_[b].y - nodes_[a].y);
+    int id = (int)segments_.size();
+    segments_.push_back({ a, b, len });
+    adj_[a].push_back({ b, id });
+    adj_[b].push_back({ a, id });
+    return id;
+  }
+
+  const Projection& projection() const { return proj_; }
+  const std::vector<Node>& nodes() const { return nodes_; }
+  const std::vector<Segment>& segments() const { return segments_; }
+  const std::vector<Arc>& arcs(int node) const { return adj_[node]; }
+
+private:
+  Projection proj_;
+  std::vector<Node> nodes_;
+  std::vector<Segment> segments_;
+  std::vector<std::vector<Arc>> adj_;
+};
+
+// ================== SPATIAL INDEX ==================
+
+// Uniform grid over segment bounding boxes. With the cell size equal to the
+// search radius, every candidate of a fix lies in the 3x3 block around the
+// fix's cell, so lookups can be cached per cell.
+class SegmentGrid {
+public:
+  SegmentGrid(const RoadGraph& graph, double cellSize) : cell_(cellSize) {
+    const auto& nodes = graph.nodes();
+    if (nodes.empty()) return;
+    double maxX = nodes[0].x, maxY = nodes[0].y;
+    minX_ = nodes[0].x; minY_ = nodes[0].y;
+    for (const auto& n : nodes) {
+      minX_ = std::min(minX_, n.x); minY_ = std::min(minY_, n.y);
+      maxX = std::max(maxX, n.x); maxY = std::max(maxY, n.y);
+    }
+    cols_ = (int)((maxX - minX_) / cell_) + 1;
+    rows_ = (int)((maxY - minY_) / cell_) + 1;
+    cells_.resize((size_t)cols_ * rows_);
+
+    const auto& segs = graph.segments();
+    for (int s = 0; s < (int)segs.size(); s++) {
+      const auto& A = nodes[segs[s].a];
+      const auto& B = nodes[segs[s].b];
+      int c0 = cellX(std::min(A.x, B.x)), c1 = cellX(std::max(A.x, B.x));
+      int r0 = cellY(std::min(A.y, B.y)), r1 = cellY(std::max(A.y, B.y));
+      for (int r = r0; r <= r1; r++)
+        for (int c = c0; c <= c1; c++) cells_[(size_t)r * cols_ + c].push_back(s);
+    }
+  }
+
+  int cellX(double x) const { return (int)std::floor((x - minX_) / cell_); }
+  int cellY(double y) const { return (int)std::floor((y - minY_) / cell_); }
+
+  // Segments touching the 3x3 block of cells around (cx, cy), deduplicated.
+  void neighbourhood(int cx, int cy, std::vector<int>& out) const {
+    out.clear();
+    for (int r = std::max(cy - 1, 0); r <= std::min(cy + 1, rows_ - 1); r++)
+      for (int c = std::max(cx - 1, 0); c <= std::min(cx + 1, cols_ - 1); c++) {
+        const auto& cell = cells_[(size_t)r * cols_ + c];
+        out.insert(out.end(), cell.begin(), cell.end());
+      }
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+  }
+
+private:
+  double cell_;
+  double minX_ = 0, minY_ = 0;
+  int cols_ = 0, rows_ = 0;
+  std::vector<std::vector<int>> cells_;
+};
+
+// ================== WORK-STEALING POOL ==================
+
+// Runs fn(task, worker) for task in [0, tasks). Tasks are dealt round-robin
+// into per-worker deques; a worker pops its own deque from the back and, once
+// empty, steals from the front of the others. Trip lengths vary a lot, so this
+// keeps every core busy without a central queue.
+inline void runWorkStealing(size_t tasks, unsigned threads,
+                            const std::function<void(size_t, unsigned)>& fn) {
+  if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = (unsigned)std::min<size_t>(threads, std::max<size_t>(tasks, 1));
+  if (threads == 1) {
+    for (size_t t = 0; t < tasks; t++) fn(t, 0);
+    return;
+  }
+
+  struct WorkQueue { std::mutex lock; std::deque<size_t> items; };
+  std::vector<WorkQueue> queues(threads);
+  for (size_t t = 0; t < tasks; t++) queues[t % threads].items.push_back(t);
+
+  auto worker = [&](unsigned self) {
+    for (;;) {
+      size_t task = 0;
+      bool found = false;
+      {
+        std::lock_guard<std::mutex> g(queues[self].lock);
+        if (!queues[self].items.empty()) {
+          task = queues[self].items.back();
+          queues[self].items.pop_back();
+          found = true;
+        }
+      }
+      for (unsigned k = 1; !found && k < threads; k++) {
+        WorkQueue& victim = queues[(self + k) % threads];
+        std::lock_guard<std::mutex> g(victim.lock);
+        if (!victim.items.empty()) {
+          task = victim.items.front();
+          victim.items.pop_front();
+          found = true;
+        }
+      }
+      // No task spawns new tasks, so all queues empty means we are done.
+      if (!found) return;
+      fn(task, self);
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (unsigned w = 1; w < threads; w++) pool.emplace_back(worker, w);
+  worker(0);
+  for (auto& th : pool) th.join();
+}
+
+// ================== MATCHER ==================
+
+struct GpsFix {
+  double lat;
+  double lon;
+  bool valid;  // false for the mock coordinates sent while TinyGPS has no fix
+};
+
+struct Trace {
+  std::string tripId;
+  std::vector<GpsFix> fixes;
+};
+
+struct MatchConfig {
+  double gpsSigma = 8.0;         // GPS noise std-dev, metres (emission model)
+  double transitionBeta = 10.0;  // route vs. straight-line tolerance, metres
+  double searchRadius = 50.0;    // max fix-to-road distance for a candidate
+  size_t maxCandidates = 8;      // closest candidates kept per fix
+  double maxRouteFactor = 4.0;   // route search bound, in multiples of the hop
+  // Fixes closer than this to the last used fix are skipped and get no
+  // MatchedFix. Off by default so every stored fix is snapped. On the bench,
+  // ~2 sigma gives about 1.4x throughput but leaves ~44% of valid fixes
+  // unmatched; only the fixes still matched lose just ~2 points of accuracy.
+  double minFixSpacing = 0.0;
+};
+
+struct MatchedFix {
+  size_t fixIndex;   // index into Trace::fixes
+  int segment;       // RoadGraph segment id
+  GeoPoint snapped;  // fix projected onto that segment
+};
+
+struct MatchResult {
+  std::string tripId;
+  std::vector<MatchedFix> matched;
+  // One polyline per continuous stretch; a new one starts when no road route
+  // connects consecutive fixes (tunnel, long signal loss, off-network riding).
+  std::vector<std::vector<GeoPoint>> geometry;
+  double distanceMeters = 0;  // on-road length of all polylines
+  size_t droppedFixes = 0;    // invalid fixes or fixes with no road in range
+  size_t skippedFixes = 0;    // within minFixSpacing of the previous used fix
+};
+
+class MapMatcher {
+public:
+  explicit MapMatcher(const RoadGraph& graph, MatchConfig config = MatchConfig())
+    : graph_(graph), config_(config), grid_(graph, config.searchRadius) {}
+
+  MatchResult match(const Trace& trace) const {
+    Workspace ws(graph_.nodes().size());
+    return match(trace, ws);
+  }
+
+  // Matches every trace, one task per trip. threads == 0 uses all cores.
+  std::vector<MatchResult> matchAll(const std::vector<Trace>& traces,
+                                    unsigned threads = 0) const {
+    std::vector<MatchResult> results(traces.size());
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    // Each workspace is node-sized, so never build more than there are trips.
+    threads = (unsigned)std::min<size_t>(threads, std::max<size_t>(traces.size(), 1));
+    std::vector<Workspace> spaces;
+    spaces.reserve(threads);
+    for (unsigned w = 0; w < threads; w++) spaces.emplace_back(graph_.nodes().size());
+    runWorkStealing(traces.size(), threads, [&](size_t t, unsigned w) {
+      results[t] = match(traces[t], spaces[w]);
+    });
+    return results;
+  }
+
+private:
+  struct Candidate {
+    int segment;
+    double x, y;     // projected point on the segment
+    double offset;   // distance from segment node a
+    double distance; // distance from the fix
+  };
+
+  // Per-worker scratch: Dijkstra state and the cell -> segments cache.
+  struct Workspace {
+    explicit Workspace(size_t nodes)
+      : dist(nodes, std::numeric_limits<double>::infinity()), pred(nodes, -1) {}
+    std::vector<double> dist;
+    std::vector<int> pred;
+    std::vector<int> touched;
+    std::unordered_map<uint64_t, std::vector<int>> cellCache;
+  };
+
+  static constexpr double kInf = std::numeric_limits<double>::infinity();
+
+  void findCandidates(double x, double y, Workspace& ws, std::vector<Candidate>& out) const {
+    out.clear();
+    int cx = grid_.cellX(x), cy = grid_.cellY(y);
+    uint64_t key = ((uint64_t)(uint32_t)cx << 32) | (uint32_t)cy;
+    auto it = ws.cellCache.find(key);
+    if (it == ws.cellCache.end()) {
+      it = ws.cellCache.emplace(key, std::vector<int>()).first;
+      grid_.neighbourhood(cx, cy, it->second);
+    }
+
+    const auto& nodes = graph_.nodes();
+    const auto& segs = graph_.segments();
+    for (int s : it->second) {
+      const auto& A = nodes[segs[s].a];
+      const auto& B = nodes[segs[s].b];
+      double dx = B.x - A.x, dy = B.y - A.y;
+      double len2 = dx * dx + dy * dy;
+      double t = len2 > 0 ? ((x - A.x) * dx + (y - A.y) * dy) / len2 : 0;
+      t = std::min(1.0, std::max(0.0, t));
+      double px = A.x + t * dx, py = A.y + t * dy;
+      double d = std::hypot(x - px, y - py);
+      if (d <= config_.searchRadius) out.push_back({ s, px, py, t * segs[s].length, d });
+    }
+    std::sort(out.begin(), out.end(),
+              [](const Candidate& l, const Candidate& r) { return l.distance < r.distance; });
+    if (out.size() > config_.maxCandidates) out.resize(config_.maxCandidates);
+  }
+
+  // Bounded Dijkstra from a point on a segment, leaving via either end.
+  void shortestFrom(const Candidate& from, double limit, Workspace& ws) const {
+    for (int n : ws.touched) { ws.dist[n] = kInf; ws.pred[n] = -1; }
+    ws.touched.clear();
+
+    using Entry = std::pair<double, int>;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> pq;
+    const auto& seg = graph_.segments()[from.segment];
+    auto relax = [&](int node, double d, int via) {
+      if (d > limit || d >= ws.dist[node]) return;
+      if (ws.dist[node] == kInf) ws.touched.push_back(node);
+      ws.dist[node] = d;
+      ws.pred[node] = via;
+      pq.push({ d, node });
+    };
+    relax(seg.a, from.offset, -1);
+    relax(seg.b, seg.length - from.offset, -1);
+
+    while (!pq.empty()) {
+      Entry e = pq.top();
+      pq.pop();
+      if (e.first > ws.dist[e.second]) continue;
+      for (const auto& arc : graph_.arcs(e.second))
+        relax(arc.to, e.first + graph_.segments()[arc.segment].length, e.second);
+    }
+  }
+
+  // Route length to `to` using the last shortestFrom(from); fills the node
+  // path when requested. Returns infinity when out of the search bound.
+  double routeTo(const Candidate& from, const Candidate& to, const Workspace& ws,
+                 std::vector<int>* path) const {
+    const auto& seg = graph_.segments()[to.segment];
+    double direct = from.segment == to.segment ? std::fabs(to.offset - from.offset) : kInf;
+    double viaA = ws.dist[seg.a] + to.offset;
+    double viaB = ws.dist[seg.b] + seg.length - to.offset;
+    double best = std::min(direct, std::min(viaA, viaB));
+    if (path) {
+      path->clear();
+      if (best < direct) {
+        for (int n = viaA <= viaB ? seg.a : seg.b; n != -1; n = ws.pred[n]) path->push_back(n);
+        std::reverse(path->begin(), path->end());
+      }
+    }
+    return best;
+  }
+
+  double linkLength(int u, int v) const {
+    double best = kInf;
+    for (const auto& arc : graph_.arcs(u))
+      if (arc.to == v) best = std::min(best, graph_.segments()[arc.segment].length);
+    return best;
+  }
+
+  MatchResult match(const Trace& trace, Workspace& ws) const {
+    MatchResult result;
+    result.tripId = trace.tripId;
+    const Projection& proj = graph_.projection();
+
+    // Viterbi lattice of the current continuous chain.
+    std::vector<std::vector<Candidate>> layers;
+    std::vector<std::vector<int>> back;
+    std::vector<size_t> layerFix;
+    std::vector<std::pair<double, double>> layerXY;
+    std::vector<double> score, next;
+    std::vector<Candidate> cands;
+
+    auto emission = [&](const Candidate& c) {
+      double z = c.distance / config_.gpsSigma;
+      return -0.5 * z * z;
+    };
+    auto hopLength = [&](size_t t, double x, double y) {
+      return std::hypot(x - layerXY[t].first, y - layerXY[t].second);
+    };
+    auto routeLimit = [&](double hop) {
+      return hop * config_.maxRouteFactor + 2 * config_.searchRadius;
+    };
+
+    auto flushChain = [&]() {
+      if (layers.empty()) return;
+      size_t steps = layers.size();
+      std::vector<int> chosen(steps);
+      chosen[steps - 1] = (int)(std::max_element(score.begin(), score.end()) - score.begin());
+      for (size_t t = steps - 1; t > 0; t--) chosen[t - 1] = back[t][chosen[t]];
+
+      // The travelled route is the node sequence between the chosen candidates.
+      // Measuring distance along it, rather than summing hop routes, ignores
+      // snapped points sliding back and forth within a segment.
+      std::vector<int> route, path;
+      for (size_t t = 0; t < steps; t++) {
+        const Candidate& c = layers[t][chosen[t]];
+        if (t > 0) {
+          const Candidate& p = layers[t - 1][chosen[t - 1]];
+          shortestFrom(p, routeLimit(hopLength(t - 1, layerXY[t].first, layerXY[t].second)), ws);
+          routeTo(p, c, ws, &path);
+          for (int n : path)
+            if (route.empty() || route.back() != n) route.push_back(n);
+        }
+        result.matched.push_back({ layerFix[t], c.segment, proj.toGeo(c.x, c.y) });
+      }
+
+      const Candidate& first = layers.front()[chosen.front()];
+      const Candidate& last = layers.back()[chosen.back()];
+      std::vector<GeoPoint> line(1, proj.toGeo(first.x, first.y));
+      if (route.empty()) {
+        result.distanceMeters += std::fabs(last.offset - first.offset);
+      } else {
+        const auto& segs = graph_.segments();
+        const auto& s0 = segs[first.segment];
+        const auto& s1 = segs[last.segment];
+        result.distanceMeters += route.front() == s0.a ? first.offset : s0.length - first.offset;
+        result.distanceMeters += route.back() == s1.a ? last.offset : s1.length - last.offset;
+        for (size_t i = 0; i < route.size(); i++) {
+          if (i > 0) result.distanceMeters += linkLength(route[i - 1], route[i]);
+          line.push_back(proj.toGeo(graph_.nodes()[route[i]].x, graph_.nodes()[route[i]].y));
+        }
+      }
+      line.push_back(proj.toGeo(last.x, last.y));
+      result.geometry.push_back(std::move(line));
+      layers.clear(); back.clear(); layerFix.clear(); layerXY.clear();
+    };
+
+    for (size_t k = 0; k < trace.fixes.size(); k++) {
+      const GpsFix& fix = trace.fixes[k];
+      if (!fix.valid) { result.droppedFixes++; continue; }
+      double x, y;
+      proj.toXY({ fix.lat, fix.lon }, x, y);
+      if (!layers.empty() && hopLength(layerXY.size() - 1, x, y) < config_.minFixSpacing) {
+        result.skippedFixes++;
+        continue;
+      }
+      findCandidates(x, y, ws, cands);
+      if (cands.empty()) { result.droppedFixes++; continue; }
+
+      std::vector<int> bp(cands.size(), -1);
+      if (!layers.empty()) {
+        double hop = hopLength(layerXY.size() - 1, x, y);
+        double limit = routeLimit(hop);
+
+        next.assign(cands.size(), -kInf);
+        const auto& prev = layers.back();
+        for (size_t i = 0; i < prev.size(); i++) {
+          if (score[i] == -kInf) continue;
+          shortestFrom(prev[i], limit, ws);
+          for (size_t j = 0; j < cands.size(); j++) {
+            double route = routeTo(prev[i], cands[j], ws, nullptr);
+            if (route > limit) continue;
+            double s = score[i] - std::fabs(route - hop) / config_.transitionBeta + emission(cands[j]);
+            if (s > next[j]) { next[j] = s; bp[j] = (int)i; }
+          }
+        }
+        double top = *std::max_element(next.begin(), next.end());
+        if (top == -kInf) {
+          flushChain();
+        } else {
+          // Keep scores near zero so long trips don't drift in precision.
+          for (double& s : next) s -= top;
+          score.swap(next);
+        }
+      }
+      if (layers.empty()) {
+        score.resize(cands.size());
+        for (size_t j = 0; j < cands.size(); j++) score[j] = emission(cands[j]);
+        std::fill(bp.begin(), bp.end(), -1);
+      }
+      layers.push_back(cands);
+      back.push_back(std::move(bp));
+      layerFix.push_back(k);
+      layerXY.push_back({ x, y });
+    }
+    flushChain();
+    return result;
+  }
+
+  const RoadGraph& graph_;
+  MatchConfig config_;
+  SegmentGrid grid_;
+};
+
+} // namespace mapmatch